@@ -4,9 +4,124 @@
 #include <algorithm>
 #include <thread>
 #include <chrono>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
 namespace fs = std::filesystem;
 
+// CRC32C (Castagnoli) checksum used by cp --verify. Uses the SSE4.2 crc32
+// instruction when the CPU has it, otherwise a byte-wise lookup table.
+class Crc32c
+{
+public:
+    static uint32_t update(uint32_t crc, const char *data, size_t size)
+    {
+#if defined(__x86_64__)
+        static const bool hasSse42 = __builtin_cpu_supports("sse4.2");
+        if (hasSse42)
+        {
+            return updateSse42(crc, data, size);
+        }
+#endif
+        return updateTable(crc, data, size);
+    }
+
+private:
+    static std::array<uint32_t, 256> makeTable()
+    {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+            }
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    static uint32_t updateTable(uint32_t crc, const char *data, size_t size)
+    {
+        static const std::array<uint32_t, 256> table = makeTable();
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2"))) static uint32_t updateSse42(uint32_t crc, const char *data, size_t size)
+    {
+        uint64_t crc64 = ~crc;
+        while (size >= sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+            data += sizeof(word);
+            size -= sizeof(word);
+        }
+
+        uint32_t crc32 = static_cast<uint32_t>(crc64);
+        while (size > 0)
+        {
+            crc32 = _mm_crc32_u8(crc32, static_cast<unsigned char>(*data));
+            ++data;
+            --size;
+        }
+        return ~crc32;
+    }
+#endif
+};
+
+// Blocking queue of buffer indices passed between the stages of a verified copy.
+// An index of -1 marks the end of the stream.
+class BufferQueue
+{
+public:
+    void push(int index)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(index);
+        }
+        ready.notify_one();
+    }
+
+    int pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]
+                   { return !items.empty(); });
+        int index = items.front();
+        items.pop_front();
+        return index;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<int> items;
+};
+
 class MyShell
 {
 public:
@@ -500,6 +615,8 @@ private:
         bool recursiveThreadMode = std::find(args.begin(), args.end(), "-r") != args.end();
         bool interactiveMode = std::find(args.begin(), args.end(), "-i") != args.end();
         bool backupMode = std::find(args.begin(), args.end(), "-b") != args.end();
+        bool verifyMode = false;
+        bool readBackMode = false;
         bool helpMode = std::find(args.begin(), args.end(), "--help") != args.end();
 
         if (helpMode)
@@ -510,14 +627,37 @@ private:
 
         std::string source;
         std::string destination;
+        std::string manifestPath;
 
         // Parse options and paths
-        for (const auto &arg : args)
+        for (size_t i = 0; i < args.size(); ++i)
         {
+            const std::string &arg = args[i];
+
             if (arg == "-r")
             {
                 recursiveThreadMode = true;
             }
+            else if (arg == "--verify")
+            {
+                verifyMode = true;
+            }
+            else if (arg == "--verify-disk")
+            {
+                verifyMode = true;
+                readBackMode = true;
+            }
+            else if (arg == "--manifest")
+            {
+                if (i + 1 >= args.size())
+                {
+                    std::cout << "--manifest requires a file." << std::endl;
+                    return;
+                }
+                // A manifest is only produced by a verified copy
+                verifyMode = true;
+                manifestPath = args[++i];
+            }
             else if (arg == "-rt")
             {
                 recursiveMode = true;
@@ -552,7 +692,31 @@ private:
 
         try
         {
-            if (fs::is_directory(absoluteSource))
+            if (verifyMode)
+            {
+                if (fs::is_directory(absoluteSource) && !recursiveMode && !recursiveThreadMode)
+                {
+                    std::cout << "cp --verify requires -r or -rt to copy a directory." << std::endl;
+                    return;
+                }
+                if (!checkVerifiedTarget(absoluteSource, destination))
+                {
+                    return;
+                }
+
+                auto start = std::chrono::high_resolution_clock::now(); // Start time
+                // Checksum the data on its way through the copy, then check the destination
+                bool verified = copyVerified(absoluteSource, destination, manifestPath, readBackMode);
+                auto end = std::chrono::high_resolution_clock::now(); // End time
+                std::chrono::duration<double> duration = (end - start) * 1000;
+                std::cout << "Copy execution time: " << duration.count() << " milliseconds" << std::endl;
+
+                if (!verified)
+                {
+                    return;
+                }
+            }
+            else if (fs::is_directory(absoluteSource))
             {
                 if (recursiveMode)
                 {
@@ -632,6 +796,366 @@ private:
         }
     }
 
+    static constexpr size_t verifyBufferSize = 1 << 20;
+    static constexpr int verifyBufferCount = 4;
+
+    struct VerifyResult
+    {
+        fs::path path;
+        uint32_t checksum = 0;
+        uintmax_t size = 0;
+        bool match = false;
+    };
+
+    // Copy buffers shared by every file of one verified copy.
+    struct VerifyState
+    {
+        std::vector<std::vector<char>> buffers;
+        std::vector<size_t> lengths;
+        bool readBack = false;
+    };
+
+    // Copies one file while checksumming the source bytes on their way to the
+    // destination. The destination is checked against the number of bytes written
+    // and, with --verify-disk, against a checksum of it read back from disk.
+    VerifyResult copyFileVerified(const fs::path &source, const fs::path &destination, VerifyState &state)
+    {
+        // FIFOs, sockets and devices would block or never end when read as a stream
+        if (!fs::is_regular_file(source))
+        {
+            throw fs::filesystem_error("cannot copy", source, destination, std::make_error_code(std::errc::invalid_argument));
+        }
+        // Opening the destination truncates it, which would empty the source first
+        if (fs::exists(destination) && fs::equivalent(source, destination))
+        {
+            throw fs::filesystem_error("source and destination are the same file", source, destination, std::make_error_code(std::errc::invalid_argument));
+        }
+
+        std::ifstream in(source, std::ios::binary);
+        if (!in)
+        {
+            throw fs::filesystem_error("cannot open source", source, std::make_error_code(std::errc::io_error));
+        }
+        std::ofstream out(destination, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            throw fs::filesystem_error("cannot open destination", destination, std::make_error_code(std::errc::io_error));
+        }
+
+        VerifyResult result;
+        uintmax_t written = 0;
+        bool readFailed = false;
+        bool writeFailed = false;
+
+        if (fs::file_size(source) <= verifyBufferSize)
+        {
+            // Small files are not worth starting the pipeline threads for
+            std::vector<char> &buffer = state.buffers[0];
+            while (in && !writeFailed)
+            {
+                in.read(buffer.data(), verifyBufferSize);
+                size_t length = static_cast<size_t>(in.gcount());
+                result.checksum = Crc32c::update(result.checksum, buffer.data(), length);
+                result.size += length;
+                out.write(buffer.data(), static_cast<std::streamsize>(length));
+                writeFailed = !out;
+                written += writeFailed ? 0 : length;
+            }
+            readFailed = in.bad();
+        }
+        else
+        {
+            copyStreamPipelined(in, out, state, result, written, readFailed, writeFailed);
+        }
+        out.close();
+
+        if (readFailed)
+        {
+            throw fs::filesystem_error("error reading source", source, std::make_error_code(std::errc::io_error));
+        }
+        if (writeFailed || out.fail())
+        {
+            throw fs::filesystem_error("error writing destination", destination, std::make_error_code(std::errc::io_error));
+        }
+
+        fs::permissions(destination, fs::status(source).permissions());
+
+        result.match = written == result.size && fs::file_size(destination) == result.size;
+        if (result.match && state.readBack)
+        {
+            uint32_t destinationChecksum = 0;
+            uintmax_t destinationSize = 0;
+            checksumFile(destination, state.buffers[0], destinationChecksum, destinationSize);
+            result.match = destinationChecksum == result.checksum && destinationSize == result.size;
+        }
+        return result;
+    }
+
+    // Runs a reader -> hasher -> writer pipeline over the shared buffers so the
+    // checksum is computed while the data is in flight.
+    void copyStreamPipelined(std::ifstream &in, std::ofstream &out, VerifyState &state, VerifyResult &result,
+                             uintmax_t &written, bool &readFailed, bool &writeFailed)
+    {
+        std::vector<std::vector<char>> &buffers = state.buffers;
+        std::vector<size_t> &lengths = state.lengths;
+        BufferQueue freeQueue;
+        BufferQueue hashQueue;
+        BufferQueue writeQueue;
+        for (int i = 0; i < verifyBufferCount; ++i)
+        {
+            freeQueue.push(i);
+        }
+
+        std::atomic<bool> cancelled{false};
+
+        std::thread reader([&]()
+                           {
+            while (true)
+            {
+                int index = freeQueue.pop();
+                if (cancelled)
+                {
+                    hashQueue.push(-1);
+                    break;
+                }
+                in.read(buffers[index].data(), verifyBufferSize);
+                lengths[index] = static_cast<size_t>(in.gcount());
+                if (lengths[index] > 0)
+                {
+                    hashQueue.push(index);
+                }
+                if (!in)
+                {
+                    readFailed = in.bad();
+                    hashQueue.push(-1);
+                    break;
+                }
+            } });
+
+        std::thread hasher;
+        try
+        {
+            hasher = std::thread([&]()
+                                 {
+                while (true)
+                {
+                    int index = hashQueue.pop();
+                    if (index < 0)
+                    {
+                        writeQueue.push(-1);
+                        break;
+                    }
+                    result.checksum = Crc32c::update(result.checksum, buffers[index].data(), lengths[index]);
+                    result.size += lengths[index];
+                    writeQueue.push(index);
+                } });
+        }
+        catch (...)
+        {
+            // Stop the reader and hand its buffers back so it can be joined
+            cancelled = true;
+            while (true)
+            {
+                int index = hashQueue.pop();
+                if (index < 0)
+                {
+                    break;
+                }
+                freeQueue.push(index);
+            }
+            reader.join();
+            throw;
+        }
+
+        // Writer runs on this thread; after a write error it keeps draining so the other stages finish
+        while (true)
+        {
+            int index = writeQueue.pop();
+            if (index < 0)
+            {
+                break;
+            }
+            if (!writeFailed)
+            {
+                out.write(buffers[index].data(), static_cast<std::streamsize>(lengths[index]));
+                writeFailed = !out;
+                written += writeFailed ? 0 : lengths[index];
+            }
+            freeQueue.push(index);
+        }
+
+        reader.join();
+        hasher.join();
+    }
+
+    // Flushes the file to disk and drops it from the page cache before reading it
+    // back, so the checksum covers what was stored rather than what was just written.
+    void checksumFile(const fs::path &path, std::vector<char> &buffer, uint32_t &checksum, uintmax_t &size)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw fs::filesystem_error("cannot open for verification", path, std::error_code(errno, std::generic_category()));
+        }
+        if (::fsync(fd) != 0)
+        {
+            std::error_code ec(errno, std::generic_category());
+            ::close(fd);
+            throw fs::filesystem_error("cannot flush for verification", path, ec);
+        }
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        checksum = 0;
+        size = 0;
+        while (true)
+        {
+            ssize_t length = ::read(fd, buffer.data(), verifyBufferSize);
+            if (length < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (length < 0)
+            {
+                std::error_code ec(errno, std::generic_category());
+                ::close(fd);
+                throw fs::filesystem_error("error reading for verification", path, ec);
+            }
+            if (length == 0)
+            {
+                break;
+            }
+            checksum = Crc32c::update(checksum, buffer.data(), static_cast<size_t>(length));
+            size += static_cast<uintmax_t>(length);
+        }
+        ::close(fd);
+    }
+
+    void cpdirectoryVerified(const fs::path &source, const fs::path &destination, const fs::path &relative,
+                             VerifyState &state, std::vector<VerifyResult> &results)
+    {
+        fs::create_directories(destination);
+
+        for (const auto &entry : fs::directory_iterator(source))
+        {
+            const fs::path currentPath = entry.path();
+            const fs::path newPath = destination / currentPath.filename();
+
+            if (fs::is_directory(currentPath))
+            {
+                cpdirectoryVerified(currentPath, newPath, relative / currentPath.filename(), state, results);
+            }
+            else
+            {
+                VerifyResult result = copyFileVerified(currentPath, newPath, state);
+                result.path = relative / currentPath.filename();
+                results.push_back(result);
+            }
+        }
+    }
+
+    // Returns the file a verified copy of source writes to.
+    fs::path verifiedTarget(const fs::path &source, const fs::path &destination)
+    {
+        return fs::is_directory(destination) ? destination / source.filename() : destination;
+    }
+
+    // Refuses verified copies that would overwrite their own source.
+    bool checkVerifiedTarget(const fs::path &source, const fs::path &destination)
+    {
+        if (fs::is_directory(source))
+        {
+            // Copying into its own subtree would recurse until the path is too long
+            fs::path canonicalSource = fs::weakly_canonical(source);
+            fs::path canonicalDestination = fs::weakly_canonical(fs::absolute(destination));
+            auto mismatch = std::mismatch(canonicalSource.begin(), canonicalSource.end(),
+                                          canonicalDestination.begin(), canonicalDestination.end());
+            if (mismatch.first == canonicalSource.end())
+            {
+                std::cout << "Cannot copy a directory into itself: " << destination << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            fs::path target = verifiedTarget(source, destination);
+            if (fs::exists(target) && fs::equivalent(source, target))
+            {
+                std::cout << "Source and destination are the same file: " << target << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Returns true when every copied file matched its source checksum.
+    bool copyVerified(const fs::path &source, const fs::path &destination, const std::string &manifestPath, bool readBack)
+    {
+        std::vector<VerifyResult> results;
+        VerifyState state;
+        state.buffers.assign(verifyBufferCount, std::vector<char>(verifyBufferSize));
+        state.lengths.assign(verifyBufferCount, 0);
+        state.readBack = readBack;
+
+        try
+        {
+            if (fs::is_directory(source))
+            {
+                cpdirectoryVerified(source, destination, fs::path(), state, results);
+            }
+            else
+            {
+                VerifyResult result = copyFileVerified(source, verifiedTarget(source, destination), state);
+                result.path = source.filename();
+                results.push_back(result);
+            }
+        }
+        catch (const fs::filesystem_error &e)
+        {
+            std::cout << "Copy stopped after " << results.size() << " file(s)" << std::endl;
+            if (!manifestPath.empty())
+            {
+                writeManifest(manifestPath, results);
+            }
+            throw;
+        }
+
+        size_t mismatches = 0;
+        for (const auto &result : results)
+        {
+            if (!result.match)
+            {
+                ++mismatches;
+                std::cout << "Verification failed: " << result.path.generic_string() << std::endl;
+            }
+        }
+        std::cout << "Verified " << results.size() << " file(s), " << mismatches << " mismatch(es)" << std::endl;
+
+        if (!manifestPath.empty())
+        {
+            writeManifest(manifestPath, results);
+        }
+
+        return mismatches == 0;
+    }
+
+    void writeManifest(const std::string &manifestPath, const std::vector<VerifyResult> &results)
+    {
+        std::ofstream manifest(manifestPath);
+        for (const auto &result : results)
+        {
+            manifest << std::hex << std::setw(8) << std::setfill('0') << result.checksum << std::dec
+                     << "  " << result.size << "  " << result.path.generic_string() << "\n";
+        }
+        if (manifest)
+        {
+            std::cout << "Manifest written to " << manifestPath << std::endl;
+        }
+        else
+        {
+            std::cout << "Error writing manifest: " << manifestPath << std::endl;
+        }
+    }
+
     void displayCopyHelp()
     {
         std::cout << "cp - Copy files and directories\n"
@@ -641,6 +1165,11 @@ private:
                   << "  -rt               Copy directories recursively with Threading\n"
                   << "  -i                Prompt before overwriting files\n"
                   << "  -b                Create a backup of the destination file\n"
+                  << "  --verify          Checksum (CRC32C) data during the copy and check that every byte\n"
+                  << "                    was written to the destination (no second read pass)\n"
+                  << "  --verify-disk     As --verify, then flush the destination to disk and read it back\n"
+                  << "                    to compare checksums (costs one cold read of the destination)\n"
+                  << "  --manifest FILE   Write a checksum manifest to FILE (implies --verify)\n"
                   << "  --help            Display this help message\n"
                   << std::endl;
     }